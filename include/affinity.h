@@ -0,0 +1,71 @@
+#pragma once
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include <pthread.h>
+#include <sched.h>
+
+using namespace std;
+
+inline int read_topology(int cpu, string field)
+{
+    int value = 0;
+    ifstream topology("/sys/devices/system/cpu/cpu" + to_string(cpu) + "/topology/" + field);
+
+    topology >> value;
+
+    return value;
+}
+
+// Allowed CPUs ordered so that consecutive workers take the physical cores of one socket,
+// then those of the next socket, and only then SMT siblings in the same socket order.
+// Runs with fewer threads than cores per socket stay on one NUMA node and no core
+// is doubled up while another is idle.
+inline vector<int> socket_ordered_cpus()
+{
+    cpu_set_t allowed;
+    // (sibling index, socket, core, cpu)
+    vector<tuple<int, int, int, int>> cpus;
+    map<pair<int, int>, int> siblings;
+    vector<int> res;
+
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(cpu_set_t), &allowed);
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET(cpu, &allowed))
+        {
+            continue;
+        }
+
+        int socket = read_topology(cpu, "physical_package_id");
+        int core = read_topology(cpu, "core_id");
+
+        // cpus are visited in increasing order, so the first one seen on a core is sibling 0
+        cpus.emplace_back(siblings[{socket, core}]++, socket, core, cpu);
+    }
+
+    sort(cpus.begin(), cpus.end());
+
+    for (auto &[sibling, socket, core, cpu] : cpus)
+    {
+        res.push_back(cpu);
+    }
+
+    return res;
+}
+
+// Pins the calling thread. Memory it touches first afterwards is placed on
+// its own NUMA node by the kernel's default first-touch policy.
+inline void pin_thread(int cpu)
+{
+    cpu_set_t cpuset;
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+}
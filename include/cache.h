@@ -0,0 +1,372 @@
+#pragma once
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <mutex>
+#include <valarray>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+using namespace std;
+
+// identifies how count_kmers normalizes profiles, bump if that changes
+const u_int32_t CACHE_NORM_FREQUENCY = 1;
+
+class SeqHash
+{
+public:
+    u_int64_t lo = 0;
+    u_int64_t hi = 0;
+
+    bool operator==(const SeqHash &other) const
+    {
+        return lo == other.lo && hi == other.hi;
+    }
+};
+
+struct SeqHashHasher
+{
+    size_t operator()(const SeqHash &h) const
+    {
+        return h.lo;
+    }
+};
+
+// MurmurHash3 x64 128-bit
+inline SeqHash hash_seq(const string &seq)
+{
+    const u_int64_t c1 = 0x87C37B91114253D5, c2 = 0x4CF5AD432745937F;
+    const char *data = seq.data();
+    size_t len = seq.length();
+    size_t nblocks = len / 16;
+    u_int64_t h1 = 0, h2 = 0, k1, k2;
+
+    auto rotl = [](u_int64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto fmix = [](u_int64_t k) {
+        k ^= k >> 33;
+        k *= 0xFF51AFD7ED558CCD;
+        k ^= k >> 33;
+        k *= 0xC4CEB9FE1A85EC53;
+        k ^= k >> 33;
+        return k;
+    };
+
+    for (size_t i = 0; i < nblocks; i++)
+    {
+        memcpy(&k1, data + i * 16, 8);
+        memcpy(&k2, data + i * 16 + 8, 8);
+
+        k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52DCE729;
+        k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495AB5;
+    }
+
+    size_t rem = len & 15;
+    k1 = 0;
+    k2 = 0;
+    memcpy(&k1, data + nblocks * 16, min(rem, (size_t)8));
+    if (rem > 8)
+    {
+        memcpy(&k2, data + nblocks * 16 + 8, rem - 8);
+        k2 *= c2; k2 = rotl(k2, 33); k2 *= c1; h2 ^= k2;
+    }
+    if (rem > 0)
+    {
+        k1 *= c1; k1 = rotl(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= len; h2 ^= len;
+    h1 += h2; h2 += h1;
+    h1 = fmix(h1); h2 = fmix(h2);
+    h1 += h2; h2 += h1;
+
+    return SeqHash{h1, h2};
+}
+
+// On-disk append-only store of k-mer vectors keyed by (sequence hash, k, normalization).
+// File layout: magic, then records of RecordHeader followed by dims doubles.
+// Records present at open are indexed and read through a read-only mapping,
+// new records are buffered and appended under an exclusive lock. Complete records
+// never change so any number of processes can read while one appends; only a torn
+// tail left by a failed append is truncated before the next append.
+class VectorCache
+{
+private:
+    struct RecordHeader
+    {
+        u_int64_t lo;
+        u_int64_t hi;
+        u_int32_t ksize;
+        u_int32_t norm;
+        u_int64_t dims;
+    };
+
+    struct IndexSlot
+    {
+        SeqHash key;
+        // offset of the record values, 0 marks an empty slot
+        u_int64_t offset = 0;
+    };
+
+    static constexpr char magic[8] = {'S', '2', 'V', 'C', 'A', 'C', 'H', '1'};
+    static constexpr size_t flush_size = 64 * 1024 * 1024;
+
+    int fd = -1;
+    string path;
+    // end of the last complete record known to this process
+    u_int64_t valid_end = sizeof(magic);
+    // set after a failed append, later records are dropped
+    bool failed = false;
+    u_int32_t ksize;
+    u_int32_t norm;
+    u_int64_t dims;
+    boost::iostreams::mapped_file_source store;
+    // open addressing on the hash itself, immutable after open so lookups need no lock
+    vector<IndexSlot> index;
+    u_int64_t index_mask = 0;
+    string pending;
+    mutex pending_mux;
+
+    VectorCache();
+
+    bool write_all(const char *buf, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t written = write(fd, buf, size);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            buf += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    // end of the last complete record, scanning only what was appended since valid_end
+    u_int64_t find_valid_end()
+    {
+        struct stat st;
+        u_int64_t pos = valid_end;
+        RecordHeader rh;
+
+        fstat(fd, &st);
+        while (pos + sizeof(RecordHeader) <= (u_int64_t)st.st_size &&
+               pread(fd, &rh, sizeof(RecordHeader), pos) == sizeof(RecordHeader) &&
+               rh.dims <= (st.st_size - pos - sizeof(RecordHeader)) / sizeof(double))
+        {
+            pos += sizeof(RecordHeader) + rh.dims * sizeof(double);
+        }
+
+        if (pos < (u_int64_t)st.st_size)
+        {
+            cout << "Dropping " << st.st_size - pos << " bytes of incomplete records from vector cache " << path << endl;
+            if (ftruncate(fd, pos) != 0)
+            {
+                // appending after the torn bytes would hide every later record from readers
+                int err = errno;
+                cout << "Unable to truncate vector cache " << path << ": " << strerror(err) << ", caching disabled for this run" << endl;
+                failed = true;
+            }
+        }
+
+        return pos;
+    }
+
+    void write_locked(const char *buf, size_t size)
+    {
+        if (failed)
+        {
+            return;
+        }
+
+        flock(fd, LOCK_EX);
+        u_int64_t end = find_valid_end();
+
+        // failed is set when a torn tail could not be removed
+        if (!failed && write_all(buf, size))
+        {
+            valid_end = end + size;
+        }
+        else if (!failed)
+        {
+            int err = errno;
+            cout << "Unable to append to vector cache " << path << ": " << strerror(err) << ", caching disabled for this run" << endl;
+            // leave no torn record behind
+            if (ftruncate(fd, end) != 0)
+            {
+                cout << "Unable to truncate vector cache " << path << endl;
+            }
+            failed = true;
+        }
+        flock(fd, LOCK_UN);
+    }
+
+    void build_index()
+    {
+        const char *data = store.data();
+        size_t size = store.size(), pos = sizeof(magic);
+        vector<pair<SeqHash, u_int64_t>> found;
+
+        // a truncated tail record is left by an interrupted append, stop there
+        while (pos + sizeof(RecordHeader) <= size)
+        {
+            RecordHeader rh;
+            memcpy(&rh, data + pos, sizeof(RecordHeader));
+            pos += sizeof(RecordHeader);
+
+            if (rh.dims > (size - pos) / sizeof(double))
+            {
+                break;
+            }
+            if (rh.ksize == ksize && rh.norm == norm && rh.dims == dims)
+            {
+                found.emplace_back(SeqHash{rh.lo, rh.hi}, pos);
+            }
+            pos += rh.dims * sizeof(double);
+            valid_end = pos;
+        }
+
+        u_int64_t slots = 1;
+        while (slots < found.size() * 2)
+        {
+            slots *= 2;
+        }
+        index.resize(slots);
+        index_mask = slots - 1;
+
+        for (auto &[key, offset] : found)
+        {
+            u_int64_t slot = key.lo & index_mask;
+            while (index[slot].offset != 0 && !(index[slot].key == key))
+            {
+                slot = (slot + 1) & index_mask;
+            }
+            if (index[slot].offset == 0)
+            {
+                index[slot].key = key;
+                index[slot].offset = offset;
+            }
+        }
+    }
+
+public:
+    size_t entries = 0;
+
+    VectorCache(string path, u_int32_t ksize, u_int32_t norm, u_int64_t dims) : path(path), ksize(ksize), norm(norm), dims(dims)
+    {
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (fd < 0)
+        {
+            throw runtime_error("Unable to open vector cache " + path);
+        }
+
+        struct stat st;
+        char head[sizeof(magic)];
+        string error;
+
+        flock(fd, LOCK_EX);
+        fstat(fd, &st);
+        if (st.st_size == 0)
+        {
+            if (!write_all(magic, sizeof(magic)))
+            {
+                error = "Unable to write vector cache " + path;
+            }
+            st.st_size = sizeof(magic);
+        }
+        // never append to a file that is not a cache, e.g. a mistyped input path
+        else if ((size_t)st.st_size < sizeof(magic) || pread(fd, head, sizeof(magic), 0) != sizeof(magic) ||
+                 memcmp(head, magic, sizeof(magic)) != 0)
+        {
+            error = path + " is not a seq2vec vector cache";
+        }
+        flock(fd, LOCK_UN);
+
+        if (!error.empty())
+        {
+            close(fd);
+            throw runtime_error(error);
+        }
+
+        if ((size_t)st.st_size > sizeof(magic))
+        {
+            // the shared lock keeps appends out while the mapping is taken
+            flock(fd, LOCK_SH);
+            store.open(path);
+            flock(fd, LOCK_UN);
+            build_index();
+        }
+
+        for (auto &slot : index)
+        {
+            entries += slot.offset != 0;
+        }
+    }
+
+    ~VectorCache()
+    {
+        flush();
+        store.close();
+        close(fd);
+    }
+
+    bool get(const SeqHash &key, valarray<double> &vec) const
+    {
+        if (index.empty())
+        {
+            return false;
+        }
+
+        u_int64_t slot = key.lo & index_mask;
+        while (index[slot].offset != 0)
+        {
+            if (index[slot].key == key)
+            {
+                vec.resize(dims);
+                memcpy(&vec[0], store.data() + index[slot].offset, dims * sizeof(double));
+                return true;
+            }
+            slot = (slot + 1) & index_mask;
+        }
+
+        return false;
+    }
+
+    void put(const SeqHash &key, const valarray<double> &vec)
+    {
+        RecordHeader rh{key.lo, key.hi, ksize, norm, dims};
+        unique_lock<mutex> lock(pending_mux);
+
+        pending.append((const char *)&rh, sizeof(RecordHeader));
+        pending.append((const char *)&vec[0], dims * sizeof(double));
+
+        if (pending.size() >= flush_size)
+        {
+            write_locked(pending.data(), pending.size());
+            pending.clear();
+        }
+    }
+
+    void flush()
+    {
+        unique_lock<mutex> lock(pending_mux);
+
+        if (!pending.empty())
+        {
+            write_locked(pending.data(), pending.size());
+            pending.clear();
+        }
+    }
+};
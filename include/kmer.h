@@ -65,18 +65,24 @@ private:
 public:
     u_int64_t kmer_counts_length = 0;
 
-    KmerCounter(uint64_t kmer_size)
+    // build_index=false skips the 4^k composition index, which is only needed
+    // by count_kmers and is too large for long k-mers
+    KmerCounter(uint64_t kmer_size, bool build_index = true)
     {
         this->kmer_size = kmer_size;
-        compute_kmer_inds();
+        if (build_index)
+        {
+            compute_kmer_inds();
+        }
     }
 
-    valarray<double> count_kmers(string seq)
+    // calls f(val, rval) for every k-mer of seq made only of [acgtACGT]
+    // val: forward and rval: reverse complement encodings
+    template <typename F>
+    void scan_kmers(const string &seq, F f) const
     {
-        valarray<double> profile((double)0, kmer_counts_length);
-        // val: forward and rval: reverse complements
-        // len==k if the k-mer is correct with [acgtACGT]{k}
         u_int64_t val = 0, rval = 0, len = 0;
+        u_int64_t mask = (u_int64_t)pow(4, kmer_size) - 1;
         char seqChar;
 
         for (size_t i = 0; i < seq.length(); i++)
@@ -92,23 +98,65 @@ public:
             }
             
             val = (val << 2);
-            val = val & ((u_int64_t)pow(4, kmer_size) - 1);
+            val = val & mask;
             val += (seqChar >> 1 & 3);
             rval += (reverse_complements[(seqChar >> 1 & 3)]<<(kmer_size*2));
             rval >>=2;
-            rval = rval & ((u_int64_t)pow(4, kmer_size) - 1);
+            rval = rval & mask;
             len++;
 
 
             if (len == kmer_size)
             {
-                // use val as the kmer for counting
                 len--;
-                profile[kmer_inds_index[val]]++;
+                f(val, rval);
             }
         }
+    }
+
+    // compact index of the canonical form of a k-mer given both encodings
+    // for odd k exactly one strand has A or C (high bit 0) as the middle base,
+    // keeping that strand and dropping the bit halves the key space
+    u_int64_t canonical_key(u_int64_t val, u_int64_t rval) const
+    {
+        if (kmer_size % 2 == 0)
+        {
+            return min(val, rval);
+        }
+
+        u_int64_t mid_bit = 2 * (kmer_size / 2) + 1;
+        u_int64_t x = (val >> mid_bit & 1) ? rval : val;
+
+        return (x >> (mid_bit + 1)) << mid_bit | (x & (((u_int64_t)1 << mid_bit) - 1));
+    }
+
+    u_int64_t canonical_key_space() const
+    {
+        return (u_int64_t)1 << (2 * kmer_size - (kmer_size % 2));
+    }
+
+    // fills a caller owned profile so workers can reuse one buffer
+    void count_kmers(const string &seq, valarray<double> &profile)
+    {
+        if (profile.size() != kmer_counts_length)
+        {
+            profile.resize(kmer_counts_length);
+        }
+        profile = 0;
+
+        scan_kmers(seq, [&](u_int64_t val, u_int64_t) {
+            // use val as the kmer for counting
+            profile[kmer_inds_index[val]]++;
+        });
+
+        profile  /= max(1.0, profile.sum());
+    }
+
+    valarray<double> count_kmers(string seq)
+    {
+        valarray<double> profile((double)0, kmer_counts_length);
 
-        profile  = profile / max(1.0, profile.sum());
+        count_kmers(seq, profile);
 
         return profile;
     }
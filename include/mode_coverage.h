@@ -0,0 +1,169 @@
+#include <iostream>
+#include <fstream>
+#include <mutex>
+#include <atomic>
+#include <zlib.h>
+#include <thread>
+#include <valarray>
+#include <vector>
+
+#include <boost/program_options.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/asio.hpp>
+
+#include "./seq.h"
+#include "./kmer.h"
+#include "./sketch.h"
+#include "./progress.h"
+#include "./output.h"
+
+using namespace std;
+
+namespace po = boost::program_options;
+namespace bio = boost::iostreams;
+namespace basio = boost::asio;
+
+namespace coveragekmers
+{
+    string format_bytes(size_t bytes)
+    {
+        if (bytes >= 1024 * 1024)
+        {
+            return to_string(bytes / (1024 * 1024)) + " MB";
+        }
+        if (bytes >= 1024)
+        {
+            return to_string(bytes / 1024) + " KB";
+        }
+        return to_string(bytes) + " bytes";
+    }
+
+    // phase one: count canonical k-mers of the whole dataset into the sketch, returns the k-mers counted
+    u_int64_t count_dataset(SeqReader &reader, KmerCounter &kc, CountMinSketch &cms, int &threads, size_t total_reads)
+    {
+        atomic<u_int64_t> total_kmers(0);
+        asio::thread_pool pool(threads);
+        ProgressDisplay pd(total_reads);
+        mutex reader_mux;
+
+        for (int _ = 0; _ < threads * 5; _++)
+        {
+            asio::post(pool, [&]() {
+                bool has_read = true;
+                Seq seq;
+                u_int64_t kmers = 0;
+
+                while (true)
+                {
+                    {
+                        unique_lock<mutex> lock(reader_mux);
+                        has_read = reader.get_seq(seq);
+                        pd++;
+                    }
+
+                    if (has_read)
+                    {
+                        kc.scan_kmers(seq.seq_string, [&](u_int64_t val, u_int64_t rval) {
+                            cms.add(kc.canonical_key(val, rval));
+                            kmers++;
+                        });
+                    }
+                    else
+                    {
+                        break;
+                    }
+                }
+                total_kmers += kmers;
+            });
+        }
+        pool.join();
+        pd.end();
+
+        return total_kmers;
+    }
+
+    // phase two: per read histogram of the global k-mer counts
+    // bin i holds k-mers with count in [i * bin_size, (i + 1) * bin_size), higher counts are dropped
+    void run(string &input, string &output, int &ksize, int &threads, char sep, int &bin_size, int &bins, size_t sketch_bytes)
+    {
+        SeqReader reader(input);
+        KmerCounter kc(ksize, false);
+        CountMinSketch cms(kc.canonical_key_space(), sketch_bytes);
+
+        cout << "Counting sequences" << endl;
+        size_t total_reads = reader.get_seq_count();
+        cout << total_reads <<  " sequences found" << endl;
+
+        cout << "Counting " << ksize << "-mers using " << (cms.is_exact() ? "exact table" : "count-min sketch")
+             << " of " << format_bytes(cms.size_bytes()) << endl;
+        u_int64_t total_kmers = count_dataset(reader, kc, cms, threads, total_reads);
+
+        // every k-mer lands once in each row, so this is the mean count per cell
+        if (!cms.is_exact() && total_kmers / cms.cells_per_row() > (u_int64_t)bin_size)
+        {
+            cout << "Warning: " << total_kmers / cms.cells_per_row() << " k-mers per sketch cell on average exceeds bin-size "
+                 << bin_size << ", counts may be over-estimated. Exact counting needs --sketch-size "
+                 << (kc.canonical_key_space() * sizeof(u_int16_t) + 1024 * 1024 - 1) / (1024 * 1024) << endl;
+        }
+        reader.rewind();
+
+        size_t per_line_size = bins * (8 + 1);
+        size_t estimated_file_size = total_reads * per_line_size; // sep + newline (9 ASCII chars per value)
+
+        bio::mapped_file_params params;
+        params.path = output;
+        params.new_file_size = estimated_file_size;
+        params.flags = bio::mapped_file::mapmode::readwrite;
+        bio::mapped_file_sink mmout(params);
+
+        cout << "Computing coverage histograms" << endl;
+        asio::thread_pool pool(threads);
+        ProgressDisplay pd(total_reads);
+        mutex reader_mux;
+
+        for (int _ = 0; _ < threads * 5; _++)
+        {
+            asio::post(pool, [&]() {
+                bool has_read = true;
+                Seq seq;
+                auto sptr = mmout.begin();
+                valarray<double> dvec(bins);
+                string line(per_line_size + 16, '\0');
+
+                while (true)
+                {
+                    {
+                        unique_lock<mutex> lock(reader_mux);
+                        has_read = reader.get_seq(seq);
+                        pd++;
+                    }
+
+                    if (has_read)
+                    {
+                        // process the read
+                        dvec = 0;
+                        kc.scan_kmers(seq.seq_string, [&](u_int64_t val, u_int64_t rval) {
+                            u_int64_t pos = cms.count(kc.canonical_key(val, rval)) / bin_size;
+
+                            if (pos < (u_int64_t)bins)
+                            {
+                                dvec[pos]++;
+                            }
+                        });
+                        dvec /= max(1.0, dvec.sum());
+
+                        size_t line_size = format_line(dvec, sep, line.data());
+                        memcpy(sptr + seq.seq_id * per_line_size, line.data(), line_size);
+                    }
+                    else
+                    {
+                        break;
+                    }
+                }
+            });
+        }
+        pool.join();
+        mmout.close();
+        pd.end();
+    }
+}
@@ -3,11 +3,16 @@
 #include <mutex>
 #include <condition_variable>
 #include <queue>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
 #include <zlib.h>
 #include <omp.h>
 #include <thread>
 #include <valarray>
 #include <vector>
+#include <numeric>
+#include <unistd.h>
 
 #include <boost/program_options.hpp>
 #include <boost/iostreams/device/mapped_file.hpp>
@@ -16,7 +21,10 @@
 
 #include "./seq.h"
 #include "./kmer.h"
+#include "./cache.h"
+#include "./affinity.h"
 #include "./progress.h"
+#include "./output.h"
 
 using namespace std;
 
@@ -26,16 +34,50 @@ namespace basio = boost::asio;
 
 namespace mmapkmers 
 {
-    void run(string &input, string &output, int &ksize, int &threads, char sep)
+    class DedupEntry
+    {
+    public:
+        size_t seq_id;
+        bool ready = false;
+    };
+
+    // fewest reads handed to a worker at a time
+    const size_t min_read_batch = 64;
+
+    // smallest batch of at least min_read_batch lines whose output is a whole number of pages,
+    // batches start at page boundaries so no output page is shared between workers
+    size_t page_aligned_batch(size_t per_line_size)
+    {
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t lines_per_unit = page_size / gcd(page_size, per_line_size);
+
+        return (min_read_batch + lines_per_unit - 1) / lines_per_unit * lines_per_unit;
+    }
+
+    // cache_path enables the on-disk vector cache, which also computes repeats of uncached sequences once,
+    // dedup computes every repeated sequence once,
+    // pin binds workers to CPUs socket by socket
+    void run(string &input, string &output, int &ksize, int &threads, char sep, string cache_path = "", bool dedup = false, bool pin = false)
     {
         SeqReader reader(input);
         KmerCounter kc(ksize);
+        unique_ptr<VectorCache> cache;
+        unordered_map<SeqHash, DedupEntry, SeqHashHasher> seen;
+        mutex seen_mux;
+        condition_variable seen_cv;
+
+        if (!cache_path.empty())
+        {
+            cache.reset(new VectorCache(cache_path, ksize, CACHE_NORM_FREQUENCY, kc.kmer_counts_length));
+            cout << cache->entries << " cached vectors found" << endl;
+        }
 
         cout << "Counting sequences" << endl;
         size_t total_reads = reader.get_seq_count();
         cout << total_reads <<  " sequences found" << endl;
         size_t per_line_size = kc.kmer_counts_length * (8 + 1);
         size_t estimated_file_size = total_reads * per_line_size; // sep + newline (9 ASCII chars per value)
+        size_t read_batch = page_aligned_batch(per_line_size);
         
         bio::mapped_file_params params;
         params.path = output;
@@ -47,50 +89,110 @@ namespace mmapkmers
         ProgressDisplay pd(total_reads);
         mutex reader_mux;
 
+        vector<int> cpus;
+        atomic<size_t> next_worker(0);
+
+        if (pin)
+        {
+            cpus = socket_ordered_cpus();
+            cout << "Pinning workers to " << cpus.size() << " CPUs" << endl;
+            if ((size_t)threads > cpus.size())
+            {
+                cout << "Warning: " << threads << " threads but only " << cpus.size()
+                     << " CPUs available, pinned workers will share CPUs; use -t " << cpus.size() << " or drop --pin" << endl;
+            }
+        }
+
         for (int _ = 0; _ < threads * 5; _++)
         {
             asio::post(pool, [&]() {
-                bool has_read = true;
-                Seq seq;
+                if (!cpus.empty())
+                {
+                    pin_thread(cpus[next_worker++ % cpus.size()]);
+                }
+
+                // per worker buffers, allocated after pinning so first touch keeps them on the worker's node
+                vector<Seq> batch(read_batch);
+                size_t batch_size;
+                valarray<double> dvec((double)0, kc.kmer_counts_length);
+                string line(per_line_size + 16, '\0');
                 auto sptr = mmout.begin();
 
                 while (true)
                 {
                     {
+                        // consecutive reads give each worker a block of output pages no other worker writes
                         unique_lock<mutex> lock(reader_mux);
-                        has_read = reader.get_seq(seq);
-                        pd++;
+                        for (batch_size = 0; batch_size < read_batch && reader.get_seq(batch[batch_size]); batch_size++)
+                        {
+                            pd++;
+                        }
                     }
 
-                    if (has_read)
+                    if (batch_size == 0)
                     {
-                        // process the read
-                        valarray<double> dvec = kc.count_kmers(seq.seq_string);
-                        ostringstream outss;
-                        outss.precision(6);
-                        outss << fixed;
+                        break;
+                    }
+
+                    for (size_t b = 0; b < batch_size; b++)
+                    {
+                        Seq &seq = batch[b];
+                        SeqHash key;
+
+                        if (cache || dedup)
+                        {
+                            key = hash_seq(seq.seq_string);
+                        }
+
+                        // with dedup every sequence is tracked, with only a cache just the misses,
+                        // so repeats of a new sequence are counted and appended once
+                        bool hit = cache && !dedup && cache->get(key, dvec);
+                        bool track = dedup || (cache && !hit);
 
-                        for (size_t j = 0; j < dvec.size(); j++)
+                        if (track)
                         {
-                            outss << dvec[j];
-                            if (j < dvec.size() - 1)
+                            unique_lock<mutex> lock(seen_mux);
+                            auto it = seen.find(key);
+
+                            if (it != seen.end())
                             {
-                                outss << sep;
+                                // copy the line of the first occurrence once it is written
+                                // elements keep their address on rehash, iterators do not
+                                DedupEntry &first = it->second;
+                                seen_cv.wait(lock, [&]() { return first.ready; });
+                                memcpy(sptr + seq.seq_id * per_line_size, sptr + first.seq_id * per_line_size, per_line_size);
+                                continue;
                             }
+                            seen.emplace(key, DedupEntry{seq.seq_id});
                         }
-                        outss << '\n';
 
-                        memcpy(sptr + seq.seq_id * per_line_size, outss.str().c_str(), outss.str().size());
-                    }
-                    else
-                    {
-                        break;
+                        // process the read
+                        if (!hit && !(cache && dedup && cache->get(key, dvec)))
+                        {
+                            kc.count_kmers(seq.seq_string, dvec);
+                            if (cache)
+                            {
+                                cache->put(key, dvec);
+                            }
+                        }
+
+                        // formatted in the worker buffer, snprintf's terminator must not reach the next line
+                        size_t line_size = format_line(dvec, sep, line.data());
+                        memcpy(sptr + seq.seq_id * per_line_size, line.data(), line_size);
+
+                        if (track)
+                        {
+                            unique_lock<mutex> lock(seen_mux);
+                            seen[key].ready = true;
+                            seen_cv.notify_all();
+                        }
                     }
                 }
             });
         }
         pool.join();
         mmout.close();
+        cache.reset();
         pd.end();
     }
 }
@@ -0,0 +1,21 @@
+#pragma once
+#include <cstdio>
+#include <valarray>
+
+using namespace std;
+
+// Writes vec as fixed 6 decimal values separated by sep and ending in a newline.
+// Values lie in [0, 1] so each takes 8 chars plus its separator; buf needs 16 spare
+// bytes for snprintf's terminator. Returns the line length.
+inline size_t format_line(const valarray<double> &vec, char sep, char *buf)
+{
+    char *ptr = buf;
+
+    for (size_t j = 0; j < vec.size(); j++)
+    {
+        ptr += snprintf(ptr, 16, "%.6f", vec[j]);
+        *ptr++ = j < vec.size() - 1 ? sep : '\n';
+    }
+
+    return ptr - buf;
+}
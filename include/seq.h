@@ -56,6 +56,13 @@ public:
         return seq_count;
     }
 
+    void rewind()
+    {
+        gzrewind(fp);
+        kseq_rewind(ks);
+        seq_id = 0;
+    }
+
     bool get_seq(Seq &seq)
     {
         if ((ret = kseq_read(ks)) >= 0)
@@ -0,0 +1,142 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+using namespace std;
+
+// Concurrent count-min sketch of saturating 16-bit counters with a fixed memory budget.
+// When the whole key space fits in the budget a single exact table is used instead.
+class CountMinSketch
+{
+private:
+    static const u_int64_t max_depth = 8;
+
+    u_int64_t depth = 0;
+    u_int64_t width = 0;
+    u_int64_t mask = 0;
+    bool exact = false;
+    unique_ptr<atomic<u_int16_t>[]> table;
+
+    CountMinSketch();
+
+    // murmur3 64-bit finalizer, salted per row
+    static u_int64_t hash(u_int64_t x, u_int64_t row)
+    {
+        x ^= (row + 1) * 0x9E3779B97F4A7C15;
+        x ^= x >> 33;
+        x *= 0xFF51AFD7ED558CCD;
+        x ^= x >> 33;
+        x *= 0xC4CEB9FE1A85EC53;
+        x ^= x >> 33;
+
+        return x;
+    }
+
+    // raises the cell to at least value, never lowers it
+    static void raise(atomic<u_int16_t> &cell, u_int16_t value)
+    {
+        u_int16_t cur = cell.load(memory_order_relaxed);
+
+        while (cur < value && !cell.compare_exchange_weak(cur, value, memory_order_relaxed))
+        {
+        }
+    }
+
+    // saturating increment
+    static void raise_by_one(atomic<u_int16_t> &cell)
+    {
+        u_int16_t cur = cell.load(memory_order_relaxed);
+
+        while (cur < UINT16_MAX && !cell.compare_exchange_weak(cur, cur + 1, memory_order_relaxed))
+        {
+        }
+    }
+
+public:
+    CountMinSketch(u_int64_t key_space, size_t memory_bytes, u_int64_t depth = 4)
+    {
+        u_int64_t slots = max((size_t)1, memory_bytes / sizeof(atomic<u_int16_t>));
+
+        if (key_space <= slots)
+        {
+            exact = true;
+            this->depth = 1;
+            width = key_space;
+        }
+        else
+        {
+            this->depth = min(depth, max_depth);
+            // largest power of two so that depth rows fit in the budget
+            width = 1;
+            while (width * 2 * this->depth <= slots)
+            {
+                width *= 2;
+            }
+            mask = width - 1;
+        }
+
+        table.reset(new atomic<u_int16_t>[this->depth * width]);
+    }
+
+    bool is_exact() const
+    {
+        return exact;
+    }
+
+    u_int64_t cells_per_row() const
+    {
+        return width;
+    }
+
+    size_t size_bytes() const
+    {
+        return depth * width * sizeof(atomic<u_int16_t>);
+    }
+
+    void add(u_int64_t key)
+    {
+        if (exact)
+        {
+            raise_by_one(table[key]);
+            return;
+        }
+
+        // conservative update: only cells at the current minimum are raised
+        atomic<u_int16_t> *cells[max_depth];
+        u_int16_t est = UINT16_MAX;
+
+        for (u_int64_t row = 0; row < depth; row++)
+        {
+            cells[row] = &table[row * width + (hash(key, row) & mask)];
+            est = min(est, cells[row]->load(memory_order_relaxed));
+        }
+
+        if (est == UINT16_MAX)
+        {
+            return;
+        }
+
+        for (u_int64_t row = 0; row < depth; row++)
+        {
+            raise(*cells[row], est + 1);
+        }
+    }
+
+    u_int16_t count(u_int64_t key) const
+    {
+        if (exact)
+        {
+            return table[key].load(memory_order_relaxed);
+        }
+
+        u_int16_t res = UINT16_MAX;
+
+        for (u_int64_t row = 0; row < depth; row++)
+        {
+            res = min(res, table[row * width + (hash(key, row) & mask)].load(memory_order_relaxed));
+        }
+
+        return res;
+    }
+};
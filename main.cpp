@@ -7,22 +7,32 @@
 #include <boost/program_options.hpp>
 
 #include "./include/mode_mmap.h"
+#include "./include/mode_coverage.h"
 
 using namespace std;
 
 int main(int ac, char **av)
 {
-    int ksize, threads;
-    string input, output, type;
+    int ksize, threads, bin_size, bins;
+    size_t sketch_size;
+    string input, output, type, mode, cache;
+    bool dedup, pin;
 
     po::options_description desc("Seq2Vec fast sequence vectorization");
 
     desc.add_options()("help,h", "show help message");
     desc.add_options()("file,f", po::value<string>(&input)->required(), "input file path");
     desc.add_options()("output,o", po::value<string>(&output)->required(), "output vectors path");
-    desc.add_options()("preset,x", po::value<string>(&type)->default_value("csv"), "output type, should be one of csv, tsv, or json");
+    desc.add_options()("preset,x", po::value<string>(&type)->default_value("csv"), "output type, should be one of csv or tsv");
     desc.add_options()("k-size,k", po::value<int>(&ksize)->default_value(3), "set k-mer size");
     desc.add_options()("threads,t", po::value<int>(&threads)->default_value(8), "set thread count");
+    desc.add_options()("cache,c", po::value<string>(&cache)->default_value(""), "vector cache path, reused across runs with the same k; repeats of uncached sequences are computed once");
+    desc.add_options()("dedup,d", po::bool_switch(&dedup), "compute vectors of repeated sequences once, keeps about 64 bytes per distinct sequence in memory");
+    desc.add_options()("pin,p", po::bool_switch(&pin), "pin worker threads to CPUs, physical cores socket by socket before SMT siblings");
+    desc.add_options()("mode,m", po::value<string>(&mode)->default_value("composition"), "vector type, should be one of composition or coverage");
+    desc.add_options()("bin-size,b", po::value<int>(&bin_size)->default_value(10), "coverage histogram bin width");
+    desc.add_options()("bins,n", po::value<int>(&bins)->default_value(32), "coverage histogram bin count");
+    desc.add_options()("sketch-size,s", po::value<size_t>(&sketch_size)->default_value(1024), "coverage k-mer counting memory in MB");
 
     po::variables_map vm;
     po::store(po::parse_command_line(ac, av, desc), vm);
@@ -35,15 +45,70 @@ int main(int ac, char **av)
 
     po::notify(vm);
 
-    if (type == "csv")
+    char sep = type == "tsv" ? '\t' : ',';
+
+    if (type != "csv" && type != "tsv")
+    {
+        cout << "Unknown preset " << type << ", should be one of csv or tsv" << endl;
+        return 1;
+    }
+
+    if (mode != "composition" && mode != "coverage")
+    {
+        cout << "Unknown mode " << mode << ", should be one of composition or coverage" << endl;
+        return 1;
+    }
+
+    if (mode == "coverage" && (!cache.empty() || dedup || pin))
+    {
+        cout << "--cache, --dedup and --pin are only supported in composition mode" << endl;
+        return 1;
+    }
+
+    if (mode == "composition" && (!vm["bin-size"].defaulted() || !vm["bins"].defaulted() || !vm["sketch-size"].defaulted()))
+    {
+        cout << "--bin-size, --bins and --sketch-size are only supported in coverage mode" << endl;
+        return 1;
+    }
+
+    if (mode == "coverage")
     {
-        cout << "Starting Seq2Vec sequence vectorization: TSV output" << endl;
-        mmapkmers::run(input, output, ksize, threads, ',');
-    } 
-    else if (type == "tsv")
+        // MetaBCC-LR uses 15-mers for coverage histograms
+        if (vm["k-size"].defaulted())
+        {
+            ksize = 15;
+        }
+
+        if (ksize < 1 || ksize > 31 || bin_size < 1 || bins < 1 || sketch_size < 1)
+        {
+            cout << "Coverage mode needs 1 <= k-size <= 31 and positive bin-size, bins and sketch-size" << endl;
+            return 1;
+        }
+
+        cout << "Starting Seq2Vec coverage histograms: " << (sep == ',' ? "CSV" : "TSV") << " output" << endl;
+        coveragekmers::run(input, output, ksize, threads, sep, bin_size, bins, sketch_size * 1024 * 1024);
+    }
+    else
     {
-        cout << "Starting Seq2Vec sequence vectorization: TSV output" << endl;
-        mmapkmers::run(input, output, ksize, threads, '\t');
+        // opening a vector cache throws on unusable paths
+        try
+        {
+            if (type == "csv")
+            {
+                cout << "Starting Seq2Vec sequence vectorization: TSV output" << endl;
+                mmapkmers::run(input, output, ksize, threads, ',', cache, dedup, pin);
+            }
+            else if (type == "tsv")
+            {
+                cout << "Starting Seq2Vec sequence vectorization: TSV output" << endl;
+                mmapkmers::run(input, output, ksize, threads, '\t', cache, dedup, pin);
+            }
+        }
+        catch (const runtime_error &e)
+        {
+            cout << e.what() << endl;
+            return 1;
+        }
     }
 
     return 0;